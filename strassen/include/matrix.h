@@ -12,6 +12,15 @@
 /// 2D integer matrix type.
 typedef struct imatrix_s imatrix_t;
 
+/// Matrix multiplication algorithms.
+typedef enum {
+  IMATRIX_BRUTE_FORCE = 0,
+  IMATRIX_RECURSIVE,
+  IMATRIX_STRASSEN,
+  IMATRIX_RECURSIVE_PARALLEL,
+  IMATRIX_TRANSPOSED
+} imatrix_algorithm_t;
+
 /**
  * @brief Create new 2D matrix of integers.
  * @param rows number of rows
@@ -95,6 +104,30 @@ imatrix_t *imatrix_substract(imatrix_t *matrix_a, imatrix_t *matrix_b);
  */
 imatrix_t *imatrix_scale(imatrix_t *matrix, int scalar);
 
+/**
+ * @brief Integer matrix transpose.
+ * @param matrix pointer to matrix (rows x cols)
+ * @returns pointer to new matrix result of matrix^T (cols x rows)
+ *
+ * Cache-oblivious: the matrix is halved along its longest side until the
+ * blocks fit a small tile, which is transposed with SIMD when available.
+ * The operation is O(n^2)
+ *
+ */
+imatrix_t *imatrix_transpose(imatrix_t *matrix);
+
+/**
+ * @brief Integer matrix transpose in place.
+ * @param matrix pointer to matrix (rows x cols), becomes (cols x rows)
+ * @returns 0 if success, -1 otherwise
+ *
+ * Square matrices are transposed without extra memory. Rectangular ones
+ * go through a temporary buffer that replaces the matrix data.
+ * The operation is O(n^2)
+ *
+ */
+int imatrix_transpose_inplace(imatrix_t *matrix);
+
 /**
  * @brief Integer matrix multiplication O(n^3).
  * @param matrix_a pointer to matrix A (n x n)
@@ -108,6 +141,21 @@ imatrix_t *imatrix_scale(imatrix_t *matrix, int scalar);
 imatrix_t *imatrix_multiply_brute_force(imatrix_t *matrix_a,
                                         imatrix_t *matrix_b);
 
+/**
+ * @brief Integer matrix multiplication with B given transposed O(n^3).
+ * @param matrix_a pointer to matrix A (n x n)
+ * @param matrix_bt pointer to matrix B^T (n x n)
+ * @returns pointer to new matrix C result of A * B (n x n)
+ *
+ * Equivalently, returns A * M^T for any M. Every element of C is the dot
+ * product of two rows, so both operands are read contiguously.
+ * Matrices A, B have same size.
+ * The operation is O(n^3)
+ *
+ */
+imatrix_t *imatrix_multiply_transposed(imatrix_t *matrix_a,
+                                       imatrix_t *matrix_bt);
+
 /**
  * @brief Integer matrix multiplication with recursive algorithm O(n^3).
  * @param matrix_a pointer to matrix A (n x n)
@@ -121,6 +169,23 @@ imatrix_t *imatrix_multiply_brute_force(imatrix_t *matrix_a,
  */
 imatrix_t *imatrix_multiply_recursive(imatrix_t *matrix_a, imatrix_t *matrix_b);
 
+/**
+ * @brief Integer matrix multiplication with parallel recursive algorithm.
+ * @param matrix_a pointer to matrix A (n x n)
+ * @param matrix_b pointer to matrix B (n x n)
+ * @returns pointer to new matrix C result of A * B (n x n)
+ *
+ * Same split as imatrix_multiply_recursive(), but the sub-products are
+ * accumulated in place (C11 += A11 * B11; C11 += A12 * B21) so no temporary
+ * matrices are needed, and the four quadrants of C are computed as parallel
+ * OpenMP tasks. Small blocks use a loop kernel instead of recursing to 1x1.
+ * Matrices A, B have same size.
+ * The operation is O(n^3)
+ *
+ */
+imatrix_t *imatrix_multiply_recursive_parallel(imatrix_t *matrix_a,
+                                               imatrix_t *matrix_b);
+
 /**
  * @brief Integer submatrix multiplication with Strassen's algorithm.
  * @param matrix_a pointer to matrix A (n x n)
@@ -134,6 +199,57 @@ imatrix_t *imatrix_multiply_recursive(imatrix_t *matrix_a, imatrix_t *matrix_b);
  */
 imatrix_t *imatrix_multiply_strassen(imatrix_t *matrix_a, imatrix_t *matrix_b);
 
+/**
+ * @brief Integer matrix multiplication with the given algorithm.
+ * @param matrix_a pointer to matrix A (n x n)
+ * @param matrix_b pointer to matrix B (n x n)
+ * @param algorithm multiplication algorithm to use
+ * @returns pointer to new matrix C result of A * B (n x n)
+ */
+imatrix_t *imatrix_multiply(imatrix_t *matrix_a, imatrix_t *matrix_b,
+                            imatrix_algorithm_t algorithm);
+
+/**
+ * @brief Check C == A * B with Freivalds' randomized algorithm.
+ * @param matrix_a pointer to matrix A (n x n)
+ * @param matrix_b pointer to matrix B (n x n)
+ * @param matrix_c pointer to the product to check (n x n)
+ * @param rounds number of random vectors tried (at least 1)
+ * @param bad_rows optional array of n entries to store mismatching rows
+ * @param bad_count optional pointer where the number of mismatching rows
+ * will be stored
+ * @returns 0 if the check passes, 1 if C is wrong, -1 on error (including
+ * rounds == 0)
+ *
+ * Each round compares A * (B * r) with C * r for a random 0/1 vector r.
+ * A wrong C passes a round with probability at most 1/2, so a wrong result
+ * goes undetected with probability at most 2^-rounds.
+ * The operation is O(rounds * n^2)
+ *
+ */
+int imatrix_verify_freivalds(imatrix_t *matrix_a, imatrix_t *matrix_b,
+                             imatrix_t *matrix_c, unsigned rounds,
+                             size_t *bad_rows, size_t *bad_count);
+
+/**
+ * @brief Integer matrix multiplication checked with Freivalds' algorithm.
+ * @param matrix_a pointer to matrix A (n x n)
+ * @param matrix_b pointer to matrix B (n x n)
+ * @param algorithm multiplication algorithm to use
+ * @param rounds number of verification rounds (at least 1)
+ * @param bad_rows optional array of n entries to store mismatching rows
+ * @param bad_count optional pointer where the number of mismatching rows
+ * will be stored
+ * @returns pointer to new matrix C result of A * B (n x n), NULL if the
+ * multiplication fails or the verification finds mismatching rows
+ *
+ * See imatrix_verify_freivalds().
+ */
+imatrix_t *imatrix_multiply_verified(imatrix_t *matrix_a, imatrix_t *matrix_b,
+                                     imatrix_algorithm_t algorithm,
+                                     unsigned rounds, size_t *bad_rows,
+                                     size_t *bad_count);
+
 /**
  * @brief Get a string representation of the matrix.
  * @param matrix pointer to the matrix
@@ -0,0 +1,139 @@
+/**
+ * @file matrix_async.h
+ * @author Gonzalo G. Fernandez
+ * @brief Asynchronous matrix multiplication queue.
+ *
+ * Multiplications are submitted to a bounded queue served by a fixed set of
+ * worker threads. Submitting returns a job handle that can be polled, waited
+ * on or cancelled, and an optional callback is run by the worker when the
+ * product is ready, so the caller can keep loading or serializing matrices
+ * while the next product is computed.
+ */
+
+#ifndef __MATRIX_ASYNC_H__
+#define __MATRIX_ASYNC_H__
+
+#include "matrix.h"
+
+/// Multiplication queue with its worker threads.
+typedef struct imatrix_queue_s imatrix_queue_t;
+
+/// Handle of a submitted multiplication.
+typedef struct imatrix_job_s imatrix_job_t;
+
+/// State of a submitted multiplication.
+typedef enum {
+  IMATRIX_JOB_PENDING = 0, ///< waiting in the queue
+  IMATRIX_JOB_RUNNING,     ///< being computed by a worker
+  IMATRIX_JOB_DONE,        ///< result available
+  IMATRIX_JOB_FAILED,      ///< multiplication returned NULL
+  IMATRIX_JOB_CANCELLED    ///< cancelled before a worker took it
+} imatrix_job_state_t;
+
+/**
+ * @brief Completion callback, run by the worker thread.
+ *
+ * It is called for jobs that finish, fail, or are cancelled because the
+ * queue is deleted. It is not called for jobs cancelled with
+ * imatrix_job_cancel(), so it never runs on the thread of the caller.
+ * The job is still running while its callback runs, and waiters are only
+ * released once it returns, so the callback must not call imatrix_job_wait()
+ * on its own job: it would wait forever. It may call imatrix_job_poll() or
+ * imatrix_job_free().
+ * @param job handle of the finished job
+ * @param result product, NULL if the job failed or was cancelled. It stays
+ * owned by the job and is valid until imatrix_job_wait() or imatrix_job_free()
+ * @param arg user argument given at submission
+ */
+typedef void (*imatrix_job_callback_t)(imatrix_job_t *job, imatrix_t *result,
+                                       void *arg);
+
+/**
+ * @brief Create a multiplication queue.
+ * @param workers number of worker threads (at least 1)
+ * @param capacity maximum number of pending jobs (at least 1)
+ * @returns pointer to the new queue, NULL on failure
+ *
+ * Parallel algorithms (IMATRIX_RECURSIVE_PARALLEL) run inside each worker,
+ * so every worker is limited to an OpenMP team of cores / workers threads
+ * (at least 1). This keeps the total thread count near the number of cores.
+ */
+imatrix_queue_t *imatrix_queue_new(size_t workers, size_t capacity);
+
+/**
+ * @brief Delete a multiplication queue.
+ * @param queue pointer to the queue
+ *
+ * Pending jobs are cancelled, running ones are finished, then the workers
+ * are joined. Job handles remain valid until imatrix_job_free(). Submitters
+ * blocked on a full queue are woken up and get NULL; submitting once the
+ * deletion has started is not allowed.
+ */
+void imatrix_queue_free(imatrix_queue_t *queue);
+
+/**
+ * @brief Submit a multiplication, blocking while the queue is full.
+ * @param queue pointer to the queue
+ * @param matrix_a pointer to matrix A (n x n)
+ * @param matrix_b pointer to matrix B (n x n)
+ * @param algorithm multiplication algorithm to use
+ * @param callback optional completion callback
+ * @param arg user argument passed to the callback
+ * @returns job handle, NULL on failure
+ *
+ * A and B are not copied and must stay alive until the job completes.
+ */
+imatrix_job_t *imatrix_queue_submit(imatrix_queue_t *queue,
+                                    imatrix_t *matrix_a, imatrix_t *matrix_b,
+                                    imatrix_algorithm_t algorithm,
+                                    imatrix_job_callback_t callback,
+                                    void *arg);
+
+/**
+ * @brief Submit a multiplication without blocking.
+ * @returns job handle, NULL if the queue is full or on failure
+ *
+ * Same parameters as imatrix_queue_submit().
+ */
+imatrix_job_t *imatrix_queue_try_submit(imatrix_queue_t *queue,
+                                        imatrix_t *matrix_a,
+                                        imatrix_t *matrix_b,
+                                        imatrix_algorithm_t algorithm,
+                                        imatrix_job_callback_t callback,
+                                        void *arg);
+
+/**
+ * @brief Get the current state of a job without blocking.
+ * @param job job handle
+ * @returns job state, IMATRIX_JOB_FAILED for a NULL handle
+ */
+imatrix_job_state_t imatrix_job_poll(imatrix_job_t *job);
+
+/**
+ * @brief Wait for a job to finish and take its result.
+ * @param job job handle
+ * @returns product owned by the caller, NULL if the job failed, was
+ * cancelled or its result was already taken
+ */
+imatrix_t *imatrix_job_wait(imatrix_job_t *job);
+
+/**
+ * @brief Cancel a job that no worker has taken yet.
+ * @param job job handle
+ * @returns 0 if cancelled, -1 if the job already started or finished
+ *
+ * The job leaves the queue right away, so its slot is free for the next
+ * submission. The completion callback is not run for the cancelled job.
+ */
+int imatrix_job_cancel(imatrix_job_t *job);
+
+/**
+ * @brief Release a job handle and any result not taken.
+ * @param job job handle
+ *
+ * The handle may be released before the job finishes; the job then runs
+ * (or is cancelled) and its result is discarded.
+ */
+void imatrix_job_free(imatrix_job_t *job);
+
+#endif // __MATRIX_ASYNC_H__
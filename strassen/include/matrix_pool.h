@@ -0,0 +1,73 @@
+/**
+ * @file matrix_pool.h
+ * @author Gonzalo G. Fernandez
+ * @brief Opt-in memory pool for matrix storage.
+ *
+ * When enabled, matrix data buffers are rounded up to power of 2 size
+ * classes and recycled instead of returned to the system, so workloads that
+ * keep creating matrices of the same size skip fresh page faults and
+ * mmap/munmap round trips. Every thread keeps a small cache per size class
+ * and spills to a shared cache protected by a lock. Recycled buffers are
+ * zeroed only when the caller asks for zeroed storage.
+ */
+
+#ifndef __MATRIX_POOL_H__
+#define __MATRIX_POOL_H__
+
+#include <stdlib.h>
+
+/// Pool usage statistics, in bytes of size class capacity.
+typedef struct {
+  size_t bytes_in_use; ///< held by live matrices
+  size_t bytes_cached; ///< free buffers kept for recycling
+  size_t high_water;   ///< peak of bytes_in_use + bytes_cached
+  size_t hits;         ///< allocations served from a cache
+  size_t misses;       ///< allocations that went to the system allocator
+} imatrix_pool_stats_t;
+
+/**
+ * @brief Enable or disable the pool for new matrices.
+ * @param enable non-zero to enable, zero to disable
+ *
+ * Buffers taken from the pool go back to it when freed, even if the pool
+ * was disabled in between. Disabled by default.
+ */
+void imatrix_pool_enable(int enable);
+
+/**
+ * @brief Check whether new matrices are drawn from the pool.
+ * @returns non-zero if the pool is enabled
+ */
+int imatrix_pool_enabled(void);
+
+/**
+ * @brief Get a buffer from the pool.
+ * @param bytes requested size
+ * @param zeroed non-zero if the buffer must be zero filled
+ * @returns pointer to the buffer, NULL on failure
+ */
+void *imatrix_pool_alloc(size_t bytes, int zeroed);
+
+/**
+ * @brief Give a buffer back to the pool.
+ * @param ptr buffer returned by imatrix_pool_alloc()
+ * @param bytes size requested when the buffer was allocated
+ */
+void imatrix_pool_release(void *ptr, size_t bytes);
+
+/**
+ * @brief Return the cached buffers to the system.
+ *
+ * Releases the shared cache and the cache of the calling thread. Caches of
+ * other threads are moved to the shared cache when those threads exit.
+ */
+void imatrix_pool_trim(void);
+
+/**
+ * @brief Get the pool usage statistics.
+ * @param stats pointer where the statistics will be stored
+ * @returns 0 if success, -1 otherwise
+ */
+int imatrix_pool_get_stats(imatrix_pool_stats_t *stats);
+
+#endif // __MATRIX_POOL_H__
@@ -0,0 +1,98 @@
+/**
+ * @file matrix_profile.h
+ * @author Gonzalo G. Fernandez
+ * @brief Optional instrumentation of the recursive multiply engines.
+ *
+ * Build with -DIMATRIX_PROFILE (make PROFILE=1) to record, for every
+ * recursion level of the recursive and Strassen engines, the time spent
+ * (inclusive, allocation, add/sub passes and leaf multiplies), the bytes
+ * allocated for temporaries, the element operations performed and, when the
+ * kernel allows it, hardware counters (cycles, instructions, LLC misses).
+ * Without the flag every hook below expands to nothing.
+ */
+
+#ifndef __MATRIX_PROFILE_H__
+#define __MATRIX_PROFILE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/// Maximum recursion depth tracked (deeper levels are folded into the last).
+#define IMATRIX_PROF_MAX_LEVELS 32
+
+/// Calls on blocks of this size or smaller are not hooked one by one: the
+/// whole subtree below the first such call is timed once and reported as a
+/// single leaf entry, so the hooks do not dominate what they measure.
+#define IMATRIX_PROF_LEAF_SIZE 16
+
+/// Multiply engines that can be profiled.
+typedef enum {
+  IMATRIX_PROF_RECURSIVE = 0,
+  IMATRIX_PROF_RECURSIVE_ACC,
+  IMATRIX_PROF_STRASSEN,
+  IMATRIX_PROF_NENGINES
+} imatrix_prof_engine_t;
+
+/// Phases whose time is accounted separately inside a recursion level.
+typedef enum {
+  IMATRIX_PROF_ALLOC = 0,
+  IMATRIX_PROF_ADDSUB,
+  IMATRIX_PROF_LEAF,
+  IMATRIX_PROF_NPHASES
+} imatrix_prof_phase_t;
+
+#ifdef IMATRIX_PROFILE
+
+/**
+ * @brief Clear all recorded statistics.
+ */
+void imatrix_profile_reset(void);
+
+/**
+ * @brief Write the recorded statistics as a JSON report.
+ * @param out stream where the report is written
+ * @returns 0 if success, -1 otherwise
+ *
+ * Hardware counters are reported as null when perf_event is not available.
+ */
+int imatrix_profile_report(FILE *out);
+
+// Hooks used by the multiply engines, not meant to be called directly.
+void imatrix_prof_enter(imatrix_prof_engine_t engine, size_t n, int level);
+void imatrix_prof_leave(void);
+uint64_t imatrix_prof_now(void);
+void imatrix_prof_add_time(imatrix_prof_phase_t phase, uint64_t ns);
+void imatrix_prof_add_bytes(size_t bytes);
+void imatrix_prof_add_ops(size_t ops);
+
+#define IMATRIX_PROF_ENTER(engine, n) imatrix_prof_enter((engine), (n), -1)
+// For engines whose calls run as tasks on other threads, where the thread
+// call depth is not the recursion level.
+#define IMATRIX_PROF_ENTER_AT(engine, n, level)                                \
+  imatrix_prof_enter((engine), (n), (level))
+#define IMATRIX_PROF_LEAVE() imatrix_prof_leave()
+#define IMATRIX_PROF_BEGIN(t) uint64_t t = imatrix_prof_now()
+#define IMATRIX_PROF_END(t, phase)                                             \
+  imatrix_prof_add_time((phase), imatrix_prof_now() - (t))
+#define IMATRIX_PROF_BYTES(bytes) imatrix_prof_add_bytes(bytes)
+#define IMATRIX_PROF_OPS(ops) imatrix_prof_add_ops(ops)
+
+#else
+
+static inline void imatrix_profile_reset(void) {}
+static inline int imatrix_profile_report(FILE *out) {
+  (void)out;
+  return 0;
+}
+
+#define IMATRIX_PROF_ENTER(engine, n) ((void)0)
+#define IMATRIX_PROF_ENTER_AT(engine, n, level) ((void)0)
+#define IMATRIX_PROF_LEAVE() ((void)0)
+#define IMATRIX_PROF_BEGIN(t)
+#define IMATRIX_PROF_END(t, phase) ((void)0)
+#define IMATRIX_PROF_BYTES(bytes) ((void)0)
+#define IMATRIX_PROF_OPS(ops) ((void)0)
+
+#endif // IMATRIX_PROFILE
+
+#endif // __MATRIX_PROFILE_H__
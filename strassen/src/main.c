@@ -1,10 +1,15 @@
 #include "matrix.h"
+#include "matrix_async.h"
+#include "matrix_pool.h"
+#include "matrix_profile.h"
 #include <stdio.h>
 #include <stdlib.h>
 
 imatrix_t *mat_a, *mat_b, *mat_c;
+imatrix_queue_t *queue;
 
 void free_matrices(void) {
+  imatrix_queue_free(queue);
   imatrix_free(mat_a);
   imatrix_free(mat_b);
   imatrix_free(mat_c);
@@ -16,6 +21,7 @@ int main(int argc, char *argv[]) {
     return -1;
   }
   size_t n = (size_t)atoi(argv[1]);
+  imatrix_pool_enable(1);
   mat_a = imatrix_new(n, n);
   if (mat_a == NULL) {
     printf("Failed matrix A creation.");
@@ -52,12 +58,45 @@ int main(int argc, char *argv[]) {
   // }
   printf("A =\r\n%s\r\n", imatrix_dump(mat_a));
   printf("B =\r\n%s\r\n", imatrix_dump(mat_b));
-  mat_c = imatrix_multiply_recursive(mat_a, mat_b);
+  // one worker, so the second job is still pending and can be cancelled
+  queue = imatrix_queue_new(1, 2);
+  if (queue == NULL) {
+    printf("Failed queue creation.");
+    free_matrices();
+    return -1;
+  }
+  imatrix_job_t *job =
+      imatrix_queue_submit(queue, mat_a, mat_b, IMATRIX_RECURSIVE, NULL, NULL);
+  imatrix_job_t *extra =
+      imatrix_queue_submit(queue, mat_a, mat_b, IMATRIX_STRASSEN, NULL, NULL);
+  if (imatrix_job_cancel(extra) == 0) {
+    printf("Extra job cancelled.\r\n");
+  }
+  mat_c = imatrix_job_wait(job);
+  imatrix_job_free(job);
+  imatrix_free(imatrix_job_wait(extra));
+  imatrix_job_free(extra);
   if (mat_c == NULL) {
     free_matrices();
     return -1;
   }
+  if (imatrix_verify_freivalds(mat_a, mat_b, mat_c, 16, NULL, NULL) != 0) {
+    printf("Wrong product.");
+    free_matrices();
+    return -1;
+  }
   printf("C =\r\n%s\r\n", imatrix_dump(mat_c));
+  imatrix_profile_report(stderr);
   free_matrices();
-  return 0;
+
+  // every matrix went back to the pool, none may still be in use
+  imatrix_pool_stats_t stats;
+  imatrix_pool_get_stats(&stats);
+  fprintf(stderr, "pool: in use %zu, cached %zu, high water %zu, %zu hits, "
+                  "%zu misses\n",
+          stats.bytes_in_use, stats.bytes_cached, stats.high_water,
+          stats.hits, stats.misses);
+  imatrix_pool_enable(0);
+  imatrix_pool_trim();
+  return stats.bytes_in_use == 0 ? 0 : -1;
 }
@@ -4,14 +4,24 @@
  * @brief Implementation of 2D matrix operations.
  */
 
+#include "matrix.h"
+#include "matrix_pool.h"
+#include "matrix_profile.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Data structure for 2D matrix matrix of int.
 typedef struct imatrix_s {
   size_t rows;
   size_t cols;
   int *data;
+  int pooled; // data comes from the matrix pool
 } imatrix_t;
 
 // Data structure with a submatrix representation of a matrix (matrix view)
@@ -26,14 +36,26 @@ typedef struct {
   int *data;
 } imatrix_view_t;
 
-imatrix_t *imatrix_new(size_t rows, size_t cols) {
+// Create a matrix, with zeroed data only if asked. Matrices whose data is
+// fully overwritten right away skip the zeroing.
+static imatrix_t *imatrix_alloc(size_t rows, size_t cols, int zeroed) {
+  if (rows != 0 && cols > SIZE_MAX / sizeof(int) / rows) {
+    return NULL; // rows * cols * sizeof(int) overflows
+  }
   imatrix_t *matrix = malloc(sizeof(imatrix_t));
   if (matrix == NULL) {
     return NULL;
   }
   matrix->rows = rows;
   matrix->cols = cols;
-  matrix->data = calloc(rows * cols, sizeof(int));
+  matrix->pooled = imatrix_pool_enabled();
+  if (matrix->pooled) {
+    matrix->data = imatrix_pool_alloc(rows * cols * sizeof(int), zeroed);
+  } else if (zeroed) {
+    matrix->data = calloc(rows * cols, sizeof(int));
+  } else {
+    matrix->data = malloc(rows * cols * sizeof(int));
+  }
   if (matrix->data == NULL) {
     free(matrix);
     return NULL;
@@ -41,10 +63,19 @@ imatrix_t *imatrix_new(size_t rows, size_t cols) {
   return matrix;
 }
 
+imatrix_t *imatrix_new(size_t rows, size_t cols) {
+  return imatrix_alloc(rows, cols, 1);
+}
+
 void imatrix_free(imatrix_t *matrix) {
   if (!matrix)
     return;
-  free(matrix->data);
+  if (matrix->pooled) {
+    imatrix_pool_release(matrix->data,
+                         matrix->rows * matrix->cols * sizeof(int));
+  } else {
+    free(matrix->data);
+  }
   matrix->data = NULL;
   free(matrix);
 }
@@ -58,12 +89,20 @@ int imatrix_get_size(imatrix_t *matrix, size_t *rows, size_t *cols) {
   return 0;
 }
 
-int imatrix_get_value(imatrix_t *matrix, size_t i, size_t j) {
-  return matrix->data[i * matrix->cols + j];
+int imatrix_get_value(imatrix_t *matrix, size_t i, size_t j, int *value) {
+  if (matrix == NULL || i >= matrix->rows || j >= matrix->cols) {
+    return -1;
+  }
+  *value = matrix->data[i * matrix->cols + j];
+  return 0;
 }
 
-void imatrix_set_value(imatrix_t *matrix, size_t i, size_t j, int value) {
+int imatrix_set_value(imatrix_t *matrix, size_t i, size_t j, int value) {
+  if (matrix == NULL || i >= matrix->rows || j >= matrix->cols) {
+    return -1;
+  }
   matrix->data[i * matrix->cols + j] = value;
+  return 0;
 }
 
 imatrix_view_t imatrix_view_from_view(imatrix_view_t parent, int row_off,
@@ -139,22 +178,287 @@ void imatrix_view_copy(imatrix_view_t src, imatrix_view_t dst) {
   }
 }
 
+// Number of rows and cols of the view backed by the parent (not padding)
+static void imatrix_view_extent(const imatrix_view_t view, size_t *rows,
+                                size_t *cols) {
+  *rows = 0;
+  *cols = 0;
+  if (view.view_rows_offset < view.parent_rows_size) {
+    *rows = view.parent_rows_size - view.view_rows_offset;
+    if (*rows > view.view_rows_size)
+      *rows = view.view_rows_size;
+  }
+  if (view.view_cols_offset < view.parent_cols_size) {
+    *cols = view.parent_cols_size - view.view_cols_offset;
+    if (*cols > view.view_cols_size)
+      *cols = view.view_cols_size;
+  }
+}
+
+// Blocks at or below this size are transposed with the tile kernel
+#define IMATRIX_TRANSPOSE_TILE 16
+
+#ifdef __SSE2__
+// Transpose of a 4x4 block of int held in four SSE registers
+static inline void imatrix_transpose_4x4_sse(__m128i *r0, __m128i *r1,
+                                             __m128i *r2, __m128i *r3) {
+  __m128i t0 = _mm_unpacklo_epi32(*r0, *r1);
+  __m128i t1 = _mm_unpacklo_epi32(*r2, *r3);
+  __m128i t2 = _mm_unpackhi_epi32(*r0, *r1);
+  __m128i t3 = _mm_unpackhi_epi32(*r2, *r3);
+  *r0 = _mm_unpacklo_epi64(t0, t1);
+  *r1 = _mm_unpackhi_epi64(t0, t1);
+  *r2 = _mm_unpacklo_epi64(t2, t3);
+  *r3 = _mm_unpackhi_epi64(t2, t3);
+}
+#endif
+
+// dst (cols x rows) = src (rows x cols)^T for one tile
+static void imatrix_transpose_tile(const int *src, size_t src_stride, int *dst,
+                                   size_t dst_stride, size_t rows,
+                                   size_t cols) {
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 4 <= rows; i += 4) {
+    size_t j = 0;
+    for (; j + 4 <= cols; j += 4) {
+      const int *s = src + i * src_stride + j;
+      __m128i r0 = _mm_loadu_si128((const __m128i *)(s));
+      __m128i r1 = _mm_loadu_si128((const __m128i *)(s + src_stride));
+      __m128i r2 = _mm_loadu_si128((const __m128i *)(s + 2 * src_stride));
+      __m128i r3 = _mm_loadu_si128((const __m128i *)(s + 3 * src_stride));
+      imatrix_transpose_4x4_sse(&r0, &r1, &r2, &r3);
+      int *d = dst + j * dst_stride + i;
+      _mm_storeu_si128((__m128i *)(d), r0);
+      _mm_storeu_si128((__m128i *)(d + dst_stride), r1);
+      _mm_storeu_si128((__m128i *)(d + 2 * dst_stride), r2);
+      _mm_storeu_si128((__m128i *)(d + 3 * dst_stride), r3);
+    }
+    // right border of the 4 rows
+    for (size_t ii = i; ii < i + 4; ii++)
+      for (size_t jj = j; jj < cols; jj++)
+        dst[jj * dst_stride + ii] = src[ii * src_stride + jj];
+  }
+#endif
+  for (; i < rows; i++)
+    for (size_t j = 0; j < cols; j++)
+      dst[j * dst_stride + i] = src[i * src_stride + j];
+}
+
+// Cache-oblivious out-of-place transpose: halve the longest side until the
+// block fits a tile
+static void imatrix_transpose_block(const int *src, size_t src_stride,
+                                    int *dst, size_t dst_stride, size_t rows,
+                                    size_t cols) {
+  if (rows <= IMATRIX_TRANSPOSE_TILE && cols <= IMATRIX_TRANSPOSE_TILE) {
+    imatrix_transpose_tile(src, src_stride, dst, dst_stride, rows, cols);
+  } else if (rows >= cols) {
+    size_t half = rows / 2;
+    imatrix_transpose_block(src, src_stride, dst, dst_stride, half, cols);
+    imatrix_transpose_block(src + half * src_stride, src_stride, dst + half,
+                            dst_stride, rows - half, cols);
+  } else {
+    size_t half = cols / 2;
+    imatrix_transpose_block(src, src_stride, dst, dst_stride, rows, half);
+    imatrix_transpose_block(src + half, src_stride, dst + half * dst_stride,
+                            dst_stride, rows, cols - half);
+  }
+}
+
+#ifdef __SSE2__
+// Swap the 4x4 block at a with the transpose of the 4x4 block at b. Both
+// blocks are loaded before storing, so a == b transposes a diagonal block.
+static inline void imatrix_transpose_swap_4x4_sse(int *a, int *b,
+                                                  size_t stride) {
+  __m128i a0 = _mm_loadu_si128((const __m128i *)(a));
+  __m128i a1 = _mm_loadu_si128((const __m128i *)(a + stride));
+  __m128i a2 = _mm_loadu_si128((const __m128i *)(a + 2 * stride));
+  __m128i a3 = _mm_loadu_si128((const __m128i *)(a + 3 * stride));
+  __m128i b0 = _mm_loadu_si128((const __m128i *)(b));
+  __m128i b1 = _mm_loadu_si128((const __m128i *)(b + stride));
+  __m128i b2 = _mm_loadu_si128((const __m128i *)(b + 2 * stride));
+  __m128i b3 = _mm_loadu_si128((const __m128i *)(b + 3 * stride));
+  imatrix_transpose_4x4_sse(&a0, &a1, &a2, &a3);
+  imatrix_transpose_4x4_sse(&b0, &b1, &b2, &b3);
+  _mm_storeu_si128((__m128i *)(a), b0);
+  _mm_storeu_si128((__m128i *)(a + stride), b1);
+  _mm_storeu_si128((__m128i *)(a + 2 * stride), b2);
+  _mm_storeu_si128((__m128i *)(a + 3 * stride), b3);
+  _mm_storeu_si128((__m128i *)(b), a0);
+  _mm_storeu_si128((__m128i *)(b + stride), a1);
+  _mm_storeu_si128((__m128i *)(b + 2 * stride), a2);
+  _mm_storeu_si128((__m128i *)(b + 3 * stride), a3);
+}
+#endif
+
+// Swap element (i, j) of a with element (j, i) of b for j in [from, cols)
+static inline void imatrix_transpose_swap_row(int *a, int *b, size_t stride,
+                                              size_t i, size_t from,
+                                              size_t cols) {
+  for (size_t j = from; j < cols; j++) {
+    int tmp = a[i * stride + j];
+    a[i * stride + j] = b[j * stride + i];
+    b[j * stride + i] = tmp;
+  }
+}
+
+// Swap tile a (rows x cols) with the transpose of tile b (cols x rows)
+static void imatrix_transpose_swap_tile(int *a, int *b, size_t stride,
+                                        size_t rows, size_t cols) {
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 4 <= rows; i += 4) {
+    size_t j = 0;
+    for (; j + 4 <= cols; j += 4)
+      imatrix_transpose_swap_4x4_sse(a + i * stride + j, b + j * stride + i,
+                                     stride);
+    // right border of the 4 rows
+    for (size_t ii = i; ii < i + 4; ii++)
+      imatrix_transpose_swap_row(a, b, stride, ii, j, cols);
+  }
+#endif
+  for (; i < rows; i++)
+    imatrix_transpose_swap_row(a, b, stride, i, 0, cols);
+}
+
+// Swap block a (rows x cols) with the transpose of block b (cols x rows)
+static void imatrix_transpose_swap(int *a, int *b, size_t stride, size_t rows,
+                                   size_t cols) {
+  if (rows <= IMATRIX_TRANSPOSE_TILE && cols <= IMATRIX_TRANSPOSE_TILE) {
+    imatrix_transpose_swap_tile(a, b, stride, rows, cols);
+  } else if (rows >= cols) {
+    size_t half = rows / 2;
+    imatrix_transpose_swap(a, b, stride, half, cols);
+    imatrix_transpose_swap(a + half * stride, b + half, stride, rows - half,
+                           cols);
+  } else {
+    size_t half = cols / 2;
+    imatrix_transpose_swap(a, b, stride, rows, half);
+    imatrix_transpose_swap(a + half, b + half * stride, stride, rows,
+                           cols - half);
+  }
+}
+
+// Cache-oblivious in-place transpose of a square (n x n) block
+static void imatrix_transpose_square(int *data, size_t stride, size_t n) {
+  if (n <= IMATRIX_TRANSPOSE_TILE) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= n; i += 4) {
+      // diagonal 4x4 block, then the 4x4 blocks right of it
+      int *diag = data + i * stride + i;
+      imatrix_transpose_swap_4x4_sse(diag, diag, stride);
+      size_t j = i + 4;
+      for (; j + 4 <= n; j += 4)
+        imatrix_transpose_swap_4x4_sse(data + i * stride + j,
+                                       data + j * stride + i, stride);
+      // right border of the 4 rows
+      for (size_t ii = i; ii < i + 4; ii++)
+        imatrix_transpose_swap_row(data, data, stride, ii, j, n);
+    }
+#endif
+    for (; i < n; i++)
+      imatrix_transpose_swap_row(data, data, stride, i, i + 1, n);
+    return;
+  }
+  size_t half = n / 2;
+  imatrix_transpose_square(data, stride, half);
+  imatrix_transpose_square(data + half * stride + half, stride, n - half);
+  imatrix_transpose_swap(data + half, data + half * stride, stride, half,
+                         n - half);
+}
+
+void imatrix_view_transpose(const imatrix_view_t src, imatrix_view_t dst) {
+  size_t rows, cols, dst_rows, dst_cols;
+  imatrix_view_extent(src, &rows, &cols);
+  imatrix_view_extent(dst, &dst_rows, &dst_cols);
+
+  // padding of src reads as zero in dst
+  if (rows < src.view_rows_size || cols < src.view_cols_size)
+    imatrix_view_fill(dst, 0);
+
+  if (rows > dst_cols)
+    rows = dst_cols;
+  if (cols > dst_rows)
+    cols = dst_rows;
+
+  imatrix_transpose_block(src.data + src.view_rows_offset *
+                                         src.parent_cols_size +
+                              src.view_cols_offset,
+                          src.parent_cols_size,
+                          dst.data + dst.view_rows_offset *
+                                         dst.parent_cols_size +
+                              dst.view_cols_offset,
+                          dst.parent_cols_size, rows, cols);
+}
+
+imatrix_t *imatrix_transpose(imatrix_t *matrix) {
+  if (matrix == NULL) {
+    return NULL;
+  }
+  imatrix_t *matrix_t = imatrix_alloc(matrix->cols, matrix->rows, 0);
+  if (matrix_t == NULL) {
+    return NULL;
+  }
+  imatrix_view_t src = {.parent_rows_size = matrix->rows,
+                        .parent_cols_size = matrix->cols,
+                        .data = matrix->data,
+                        .view_rows_offset = 0,
+                        .view_cols_offset = 0,
+                        .view_rows_size = matrix->rows,
+                        .view_cols_size = matrix->cols,
+                        .pad = 0};
+  imatrix_view_t dst = {.parent_rows_size = matrix_t->rows,
+                        .parent_cols_size = matrix_t->cols,
+                        .data = matrix_t->data,
+                        .view_rows_offset = 0,
+                        .view_cols_offset = 0,
+                        .view_rows_size = matrix_t->rows,
+                        .view_cols_size = matrix_t->cols,
+                        .pad = 0};
+  imatrix_view_transpose(src, dst);
+  return matrix_t;
+}
+
+int imatrix_transpose_inplace(imatrix_t *matrix) {
+  if (matrix == NULL) {
+    return -1;
+  }
+  if (matrix->rows == matrix->cols) {
+    imatrix_transpose_square(matrix->data, matrix->cols, matrix->rows);
+    return 0;
+  }
+
+  // rectangular: transpose into a new buffer and take it over
+  imatrix_t *matrix_t = imatrix_transpose(matrix);
+  if (matrix_t == NULL) {
+    return -1;
+  }
+  int *data = matrix->data;
+  matrix->data = matrix_t->data;
+  matrix->rows = matrix_t->rows;
+  matrix->cols = matrix_t->cols;
+  matrix_t->data = data;
+  int pooled = matrix->pooled;
+  matrix->pooled = matrix_t->pooled;
+  matrix_t->pooled = pooled;
+  imatrix_free(matrix_t);
+  return 0;
+}
+
 imatrix_t *imatrix_scale(imatrix_t *matrix, int scalar) {
   size_t matrix_rows, matrix_cols;
   if (imatrix_get_size(matrix, &matrix_rows, &matrix_cols) < 0) {
     return NULL;
   }
-  imatrix_t *matrix_scaled = imatrix_new(matrix_rows, matrix_cols);
+  imatrix_t *matrix_scaled = imatrix_alloc(matrix_rows, matrix_cols, 0);
   if (matrix_scaled == NULL) {
     return NULL;
   }
 
-  int aij;
-  for (size_t i = 0; i < matrix_rows; i++) {
-    for (size_t j = 0; j < matrix_cols; j++) {
-      aij = imatrix_get_value(matrix, i, j);
-      imatrix_set_value(matrix_scaled, i, j, aij * scalar);
-    }
+  // both matrices have the same shape, so they share the element index
+  for (size_t k = 0; k < matrix_rows * matrix_cols; k++) {
+    matrix_scaled->data[k] = matrix->data[k] * scalar;
   }
   return matrix_scaled;
 }
@@ -171,18 +475,13 @@ imatrix_t *imatrix_add(imatrix_t *matrix_a, imatrix_t *matrix_b) {
   if (matrixa_rows != matrixb_rows || matrixa_cols != matrixb_cols) {
     return NULL;
   }
-  imatrix_t *matrix_c = imatrix_new(matrixa_rows, matrixa_cols);
+  imatrix_t *matrix_c = imatrix_alloc(matrixa_rows, matrixa_cols, 0);
   if (matrix_c == NULL) {
     return NULL;
   }
 
-  int aij, bij;
-  for (size_t i = 0; i < matrixa_rows; i++) {
-    for (size_t j = 0; j < matrixa_cols; j++) {
-      aij = imatrix_get_value(matrix_a, i, j);
-      bij = imatrix_get_value(matrix_b, i, j);
-      imatrix_set_value(matrix_c, i, j, aij + bij);
-    }
+  for (size_t k = 0; k < matrixa_rows * matrixa_cols; k++) {
+    matrix_c->data[k] = matrix_a->data[k] + matrix_b->data[k];
   }
   return matrix_c;
 }
@@ -190,7 +489,7 @@ imatrix_t *imatrix_add(imatrix_t *matrix_a, imatrix_t *matrix_b) {
 void imatrix_view_add(const imatrix_view_t mat_view_a,
                       const imatrix_view_t mat_view_b,
                       imatrix_view_t mat_view_c) {
-
+  IMATRIX_PROF_BEGIN(t0);
   for (size_t i = 0; i < mat_view_a.view_rows_size; i++) {
     for (size_t j = 0; j < mat_view_a.view_cols_size; j++) {
       imatrix_view_set_value(mat_view_c, i, j,
@@ -198,11 +497,14 @@ void imatrix_view_add(const imatrix_view_t mat_view_a,
                                  imatrix_view_get_value(mat_view_b, i, j));
     }
   }
+  IMATRIX_PROF_OPS(mat_view_a.view_rows_size * mat_view_a.view_cols_size);
+  IMATRIX_PROF_END(t0, IMATRIX_PROF_ADDSUB);
 }
 
 void imatrix_view_sub(const imatrix_view_t mat_view_a,
                       const imatrix_view_t mat_view_b,
                       imatrix_view_t mat_view_c) {
+  IMATRIX_PROF_BEGIN(t0);
   for (size_t i = 0; i < mat_view_a.view_rows_size; i++) {
     for (size_t j = 0; j < mat_view_a.view_cols_size; j++) {
       imatrix_view_set_value(mat_view_c, i, j,
@@ -210,6 +512,8 @@ void imatrix_view_sub(const imatrix_view_t mat_view_a,
                                  imatrix_view_get_value(mat_view_b, i, j));
     }
   }
+  IMATRIX_PROF_OPS(mat_view_a.view_rows_size * mat_view_a.view_cols_size);
+  IMATRIX_PROF_END(t0, IMATRIX_PROF_ADDSUB);
 }
 
 imatrix_t *imatrix_multiply_brute_force(imatrix_t *matrix_a,
@@ -226,20 +530,61 @@ imatrix_t *imatrix_multiply_brute_force(imatrix_t *matrix_a,
   if (matrixa_cols != n || matrixb_rows != n || matrixb_cols != n) {
     return NULL;
   }
-  imatrix_t *matrix_c = imatrix_new(n, n);
+  imatrix_t *matrix_c = imatrix_alloc(n, n, 0);
   if (matrix_c == NULL) {
     return NULL;
   }
 
-  int cij;
+  // shapes were checked above, index the data directly
   for (size_t i = 0; i < n; i++) {
+    const int *a_row = matrix_a->data + i * n;
     for (size_t j = 0; j < n; j++) {
-      cij = 0;
+      int cij = 0;
       for (size_t k = 0; k < n; k++) {
-        cij += imatrix_get_value(matrix_a, i, k) *
-               imatrix_get_value(matrix_b, k, j);
+        cij += a_row[k] * matrix_b->data[k * n + j];
       }
-      imatrix_set_value(matrix_c, i, j, cij);
+      matrix_c->data[i * n + j] = cij;
+    }
+  }
+  return matrix_c;
+}
+
+// Dot product of two contiguous rows
+static int imatrix_dot(const int *restrict a, const int *restrict b,
+                       size_t n) {
+  int acc = 0;
+#pragma omp simd reduction(+ : acc)
+  for (size_t k = 0; k < n; k++) {
+    acc += a[k] * b[k];
+  }
+  return acc;
+}
+
+imatrix_t *imatrix_multiply_transposed(imatrix_t *matrix_a,
+                                       imatrix_t *matrix_bt) {
+  size_t matrixa_rows, matrixa_cols;
+  size_t matrixbt_rows, matrixbt_cols;
+  if (imatrix_get_size(matrix_a, &matrixa_rows, &matrixa_cols) < 0) {
+    return NULL;
+  }
+  if (imatrix_get_size(matrix_bt, &matrixbt_rows, &matrixbt_cols) < 0) {
+    return NULL;
+  }
+  size_t n = matrixa_rows;
+  if (matrixa_cols != n || matrixbt_rows != n || matrixbt_cols != n) {
+    return NULL;
+  }
+  imatrix_t *matrix_c = imatrix_alloc(n, n, 0);
+  if (matrix_c == NULL) {
+    return NULL;
+  }
+
+  // c[i][j] = row i of A . row j of B^T, both read contiguously
+  for (size_t i = 0; i < n; i++) {
+    const int *a_row = matrix_a->data + i * n;
+    for (size_t j = 0; j < n; j++) {
+      matrix_c->data[i * n + j] =
+          imatrix_dot(a_row, matrix_bt->data + j * n, n);
     }
   }
   return matrix_c;
@@ -302,12 +647,17 @@ void imatrix_view_split_x4(imatrix_view_t input, imatrix_view_t *a11,
 void imatrix_view_multiply_recursive(const imatrix_view_t A,
                                      const imatrix_view_t B, imatrix_view_t C) {
   size_t n = A.view_rows_size;
+  IMATRIX_PROF_ENTER(IMATRIX_PROF_RECURSIVE, n);
 
   // base case condition
   if (n == 1) {
+    IMATRIX_PROF_BEGIN(t_leaf);
     imatrix_view_set_value(C, 0, 0,
                            imatrix_view_get_value(A, 0, 0) *
                                imatrix_view_get_value(B, 0, 0));
+    IMATRIX_PROF_OPS(1);
+    IMATRIX_PROF_END(t_leaf, IMATRIX_PROF_LEAF);
+    IMATRIX_PROF_LEAVE();
     return;
   }
 
@@ -323,13 +673,17 @@ void imatrix_view_multiply_recursive(const imatrix_view_t A,
   size_t block = (n / 2) + (n % 2);
 
   // temp matrices
-  imatrix_t *T1 = imatrix_new(block, block);
-  imatrix_t *T2 = imatrix_new(block, block);
+  IMATRIX_PROF_BEGIN(t_alloc);
+  imatrix_t *T1 = imatrix_alloc(block, block, 0);
+  imatrix_t *T2 = imatrix_alloc(block, block, 0);
+  IMATRIX_PROF_END(t_alloc, IMATRIX_PROF_ALLOC);
   if (!T1 || !T2) {
     imatrix_free(T1);
     imatrix_free(T2);
+    IMATRIX_PROF_LEAVE();
     return;
   }
+  IMATRIX_PROF_BYTES(2 * block * block * sizeof(int));
 
   imatrix_view_t V1 = {.parent_rows_size = block,
                        .parent_cols_size = block,
@@ -371,19 +725,139 @@ void imatrix_view_multiply_recursive(const imatrix_view_t A,
   imatrix_view_multiply_recursive(A22, B22, V2);
   imatrix_view_add(V1, V2, C22);
 
+  IMATRIX_PROF_BEGIN(t_free);
   imatrix_free(T1);
   imatrix_free(T2);
+  IMATRIX_PROF_END(t_free, IMATRIX_PROF_ALLOC);
+  IMATRIX_PROF_LEAVE();
+}
+
+// Blocks at or below this size are multiplied with a loop kernel
+#define IMATRIX_ACC_LEAF_SIZE 32
+// Blocks at or below this size are not split into parallel tasks
+#define IMATRIX_ACC_TASK_SIZE 128
+
+// C += A * B on the non padded part of the views, i-k-j order so the inner
+// loop streams rows of B and C contiguously
+static void imatrix_view_multiply_acc_leaf(const imatrix_view_t A,
+                                           const imatrix_view_t B,
+                                           imatrix_view_t C) {
+  size_t a_rows, a_cols, b_rows, b_cols, c_rows, c_cols;
+  imatrix_view_extent(A, &a_rows, &a_cols);
+  imatrix_view_extent(B, &b_rows, &b_cols);
+  imatrix_view_extent(C, &c_rows, &c_cols);
+
+  size_t rows = a_rows < c_rows ? a_rows : c_rows;
+  size_t cols = b_cols < c_cols ? b_cols : c_cols;
+  size_t inner = a_cols < b_rows ? a_cols : b_rows;
+
+  for (size_t i = 0; i < rows; i++) {
+    const int *a_row = A.data + (A.view_rows_offset + i) * A.parent_cols_size +
+                       A.view_cols_offset;
+    int *c_row = C.data + (C.view_rows_offset + i) * C.parent_cols_size +
+                 C.view_cols_offset;
+    for (size_t k = 0; k < inner; k++) {
+      int aik = a_row[k];
+      if (aik == 0)
+        continue;
+      const int *b_row = B.data +
+                         (B.view_rows_offset + k) * B.parent_cols_size +
+                         B.view_cols_offset;
+#pragma omp simd
+      for (size_t j = 0; j < cols; j++) {
+        c_row[j] += aik * b_row[j];
+      }
+    }
+  }
+  IMATRIX_PROF_OPS(rows * inner * cols);
+}
+
+// C += A * B, accumulating the sub-products directly into C
+static void imatrix_view_multiply_acc(const imatrix_view_t A,
+                                      const imatrix_view_t B, imatrix_view_t C,
+                                      int level) {
+  size_t n = A.view_rows_size;
+  IMATRIX_PROF_ENTER_AT(IMATRIX_PROF_RECURSIVE_ACC, n, level);
+  (void)level; // only used by the instrumentation
+
+  // base case condition
+  if (n <= IMATRIX_ACC_LEAF_SIZE) {
+    IMATRIX_PROF_BEGIN(t_leaf);
+    imatrix_view_multiply_acc_leaf(A, B, C);
+    IMATRIX_PROF_END(t_leaf, IMATRIX_PROF_LEAF);
+    IMATRIX_PROF_LEAVE();
+    return;
+  }
+
+  // split A, B, and C in 4 (n/2 x n/2) matrices
+  imatrix_view_t A11, A12, A21, A22;
+  imatrix_view_t B11, B12, B21, B22;
+  imatrix_view_t C11, C12, C21, C22;
+
+  imatrix_view_split_x4(A, &A11, &A12, &A21, &A22);
+  imatrix_view_split_x4(B, &B11, &B12, &B21, &B22);
+  imatrix_view_split_x4(C, &C11, &C12, &C21, &C22);
+
+  // each quadrant of C is written by a single task, so the four tasks are
+  // independent; the two products of a quadrant stay in sequence
+  int spawn = n > IMATRIX_ACC_TASK_SIZE;
+
+  // C11 += A11*B11 + A12*B21
+#pragma omp task if (spawn)
+  {
+    imatrix_view_multiply_acc(A11, B11, C11, level + 1);
+    imatrix_view_multiply_acc(A12, B21, C11, level + 1);
+  }
+
+  // C12 += A11*B12 + A12*B22
+#pragma omp task if (spawn)
+  {
+    imatrix_view_multiply_acc(A11, B12, C12, level + 1);
+    imatrix_view_multiply_acc(A12, B22, C12, level + 1);
+  }
+
+  // C21 += A21*B11 + A22*B21
+#pragma omp task if (spawn)
+  {
+    imatrix_view_multiply_acc(A21, B11, C21, level + 1);
+    imatrix_view_multiply_acc(A22, B21, C21, level + 1);
+  }
+
+  // C22 += A21*B12 + A22*B22
+#pragma omp task if (spawn)
+  {
+    imatrix_view_multiply_acc(A21, B12, C22, level + 1);
+    imatrix_view_multiply_acc(A22, B22, C22, level + 1);
+  }
+
+#pragma omp taskwait
+  (void)spawn;
+  IMATRIX_PROF_LEAVE();
+}
+
+void imatrix_view_multiply_recursive_parallel(const imatrix_view_t A,
+                                              const imatrix_view_t B,
+                                              imatrix_view_t C) {
+  imatrix_view_fill(C, 0);
+#pragma omp parallel
+#pragma omp single
+  imatrix_view_multiply_acc(A, B, C, 0);
 }
 
 void imatrix_view_multiply_strassen(const imatrix_view_t A,
                                     const imatrix_view_t B, imatrix_view_t C) {
   size_t n = A.view_rows_size;
+  IMATRIX_PROF_ENTER(IMATRIX_PROF_STRASSEN, n);
 
   // base case condition
   if (n == 1) {
+    IMATRIX_PROF_BEGIN(t_leaf);
     imatrix_view_set_value(C, 0, 0,
                            imatrix_view_get_value(A, 0, 0) *
                                imatrix_view_get_value(B, 0, 0));
+    IMATRIX_PROF_OPS(1);
+    IMATRIX_PROF_END(t_leaf, IMATRIX_PROF_LEAF);
+    IMATRIX_PROF_LEAVE();
     return;
   }
 
@@ -399,15 +873,18 @@ void imatrix_view_multiply_strassen(const imatrix_view_t A,
   size_t block = (n / 2) + (n % 2);
 
   // temp matrices
-  imatrix_t *T1 = imatrix_new(block, block);
-  imatrix_t *T2 = imatrix_new(block, block);
-  imatrix_t *P1 = imatrix_new(block, block);
-  imatrix_t *P2 = imatrix_new(block, block);
-  imatrix_t *P3 = imatrix_new(block, block);
-  imatrix_t *P4 = imatrix_new(block, block);
-  imatrix_t *P5 = imatrix_new(block, block);
-  imatrix_t *P6 = imatrix_new(block, block);
-  imatrix_t *P7 = imatrix_new(block, block);
+  IMATRIX_PROF_BEGIN(t_alloc);
+  imatrix_t *T1 = imatrix_alloc(block, block, 0);
+  imatrix_t *T2 = imatrix_alloc(block, block, 0);
+  imatrix_t *P1 = imatrix_alloc(block, block, 0);
+  imatrix_t *P2 = imatrix_alloc(block, block, 0);
+  imatrix_t *P3 = imatrix_alloc(block, block, 0);
+  imatrix_t *P4 = imatrix_alloc(block, block, 0);
+  imatrix_t *P5 = imatrix_alloc(block, block, 0);
+  imatrix_t *P6 = imatrix_alloc(block, block, 0);
+  imatrix_t *P7 = imatrix_alloc(block, block, 0);
+  IMATRIX_PROF_END(t_alloc, IMATRIX_PROF_ALLOC);
+  IMATRIX_PROF_BYTES(9 * block * block * sizeof(int));
 
   imatrix_view_t vT1 = {block, block, block, block, 0, 0, 0, T1->data};
   imatrix_view_t vT2 = vT1;
@@ -475,6 +952,7 @@ void imatrix_view_multiply_strassen(const imatrix_view_t A,
   imatrix_view_add(vT1, vP3, vT2);
   imatrix_view_add(vT2, vP6, C22);
 
+  IMATRIX_PROF_BEGIN(t_free);
   imatrix_free(T1);
   imatrix_free(T2);
   imatrix_free(P1);
@@ -484,6 +962,8 @@ void imatrix_view_multiply_strassen(const imatrix_view_t A,
   imatrix_free(P5);
   imatrix_free(P6);
   imatrix_free(P7);
+  IMATRIX_PROF_END(t_free, IMATRIX_PROF_ALLOC);
+  IMATRIX_PROF_LEAVE();
 }
 
 size_t next_power2(size_t n) {
@@ -522,7 +1002,7 @@ imatrix_t *imatrix_top_left(const imatrix_t *src, size_t n) {
   if (!src || n > src->rows || n > src->cols)
     return NULL;
 
-  imatrix_t *dst = imatrix_new(n, n);
+  imatrix_t *dst = imatrix_alloc(n, n, 0);
   if (!dst)
     return NULL;
 
@@ -535,11 +1015,27 @@ imatrix_t *imatrix_top_left(const imatrix_t *src, size_t n) {
   return dst;
 }
 
-imatrix_t *imatrix_multiply_recursive(imatrix_t *mat_a, imatrix_t *mat_b) {
+// Recursive multiply engine working on (n2 x n2) views, n2 power of 2
+typedef void (*imatrix_view_multiply_fn)(const imatrix_view_t A,
+                                         const imatrix_view_t B,
+                                         imatrix_view_t C);
+
+// Pad A and B to the next power of 2, run the engine, and crop the result
+static imatrix_t *imatrix_multiply_padded(imatrix_t *mat_a, imatrix_t *mat_b,
+                                          imatrix_view_multiply_fn multiply) {
+  if (!mat_a || !mat_b || mat_a->rows != mat_b->rows ||
+      mat_a->cols != mat_b->cols)
+    return NULL;
+
   size_t n = mat_a->rows;
   size_t n2 = next_power2(n);
   imatrix_t *mat_a_tmp = imatrix_pad_to_p(mat_a, n2);
   imatrix_t *mat_b_tmp = imatrix_pad_to_p(mat_b, n2);
+  imatrix_t *mat_c_tmp = imatrix_alloc(n2, n2, 0);
+  imatrix_t *mat_c = NULL;
+  if (!mat_a_tmp || !mat_b_tmp || !mat_c_tmp)
+    goto cleanup;
+
   imatrix_view_t mat_view_a = {.parent_rows_size = n2,
                                .parent_cols_size = n2,
                                .data = mat_a_tmp->data,
@@ -548,28 +1044,174 @@ imatrix_t *imatrix_multiply_recursive(imatrix_t *mat_a, imatrix_t *mat_b) {
                                .view_rows_size = n2,
                                .view_cols_size = n2,
                                .pad = 1};
-  imatrix_view_t mat_view_b = {.parent_rows_size = n2,
-                               .parent_cols_size = n2,
-                               .data = mat_b_tmp->data,
-                               .view_rows_offset = 0,
-                               .view_cols_offset = 0,
-                               .view_rows_size = n2,
-                               .view_cols_size = n2,
-                               .pad = 1};
+  imatrix_view_t mat_view_b = mat_view_a;
+  mat_view_b.data = mat_b_tmp->data;
+  imatrix_view_t mat_view_c = mat_view_a;
+  mat_view_c.data = mat_c_tmp->data;
 
-  imatrix_t *mat_c_tmp = imatrix_new(n2, n2);
-  imatrix_view_t mat_view_c = {.parent_rows_size = n2,
-                               .parent_cols_size = n2,
-                               .data = mat_c_tmp->data,
-                               .view_rows_offset = 0,
-                               .view_cols_offset = 0,
-                               .view_rows_size = n2,
-                               .view_cols_size = n2,
-                               .pad = 1};
-  imatrix_view_multiply_strassen(mat_view_a, mat_view_b, mat_view_c);
-  imatrix_t *mat_c = imatrix_top_left(mat_c_tmp, n);
+  multiply(mat_view_a, mat_view_b, mat_view_c);
+  mat_c = imatrix_top_left(mat_c_tmp, n);
+
+cleanup:
   imatrix_free(mat_a_tmp);
   imatrix_free(mat_b_tmp);
   imatrix_free(mat_c_tmp);
   return mat_c;
 }
+
+imatrix_t *imatrix_multiply_recursive(imatrix_t *mat_a, imatrix_t *mat_b) {
+  return imatrix_multiply_padded(mat_a, mat_b,
+                                 imatrix_view_multiply_recursive);
+}
+
+imatrix_t *imatrix_multiply_recursive_parallel(imatrix_t *mat_a,
+                                               imatrix_t *mat_b) {
+  return imatrix_multiply_padded(mat_a, mat_b,
+                                 imatrix_view_multiply_recursive_parallel);
+}
+
+imatrix_t *imatrix_multiply_strassen(imatrix_t *mat_a, imatrix_t *mat_b) {
+  return imatrix_multiply_padded(mat_a, mat_b, imatrix_view_multiply_strassen);
+}
+
+imatrix_t *imatrix_multiply(imatrix_t *mat_a, imatrix_t *mat_b,
+                            imatrix_algorithm_t algorithm) {
+  switch (algorithm) {
+  case IMATRIX_BRUTE_FORCE:
+    return imatrix_multiply_brute_force(mat_a, mat_b);
+  case IMATRIX_RECURSIVE:
+    return imatrix_multiply_recursive(mat_a, mat_b);
+  case IMATRIX_STRASSEN:
+    return imatrix_multiply_strassen(mat_a, mat_b);
+  case IMATRIX_RECURSIVE_PARALLEL:
+    return imatrix_multiply_recursive_parallel(mat_a, mat_b);
+  case IMATRIX_TRANSPOSED: {
+    imatrix_t *mat_bt = imatrix_transpose(mat_b);
+    imatrix_t *mat_c = imatrix_multiply_transposed(mat_a, mat_bt);
+    imatrix_free(mat_bt);
+    return mat_c;
+  }
+  }
+  return NULL;
+}
+
+// xorshift64* generator, kept local so rand() state is not disturbed
+static uint64_t imatrix_random_next(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+// y = M * x, every row is a contiguous dot product. Arithmetic wraps modulo
+// 2^64 so the check is exact for the ring Z/2^64 and never overflows.
+static void imatrix_matvec(const int *restrict m, size_t rows, size_t cols,
+                           const uint64_t *restrict x, uint64_t *restrict y) {
+  for (size_t i = 0; i < rows; i++) {
+    const int *restrict row = m + i * cols;
+    uint64_t acc = 0;
+#pragma omp simd reduction(+ : acc)
+    for (size_t j = 0; j < cols; j++) {
+      acc += (uint64_t)(int64_t)row[j] * x[j];
+    }
+    y[i] = acc;
+  }
+}
+
+int imatrix_verify_freivalds(imatrix_t *mat_a, imatrix_t *mat_b,
+                             imatrix_t *mat_c, unsigned rounds,
+                             size_t *bad_rows, size_t *bad_count) {
+  if (bad_count)
+    *bad_count = 0;
+  if (!mat_a || !mat_b || !mat_c || rounds == 0)
+    return -1; // zero rounds would report an unchecked product as verified
+  size_t n = mat_a->rows;
+  if (mat_a->cols != n || mat_b->rows != n || mat_b->cols != n ||
+      mat_c->rows != n || mat_c->cols != n)
+    return -1;
+
+  uint64_t *r = malloc(n * sizeof(uint64_t));
+  uint64_t *br = malloc(n * sizeof(uint64_t));
+  uint64_t *abr = malloc(n * sizeof(uint64_t));
+  uint64_t *cr = malloc(n * sizeof(uint64_t));
+  unsigned char *mismatch = calloc(n, sizeof(unsigned char));
+  int ret = -1;
+  if (!r || !br || !abr || !cr || !mismatch)
+    goto cleanup;
+
+  static uint64_t seed_counter;
+  uint64_t state = (uint64_t)time(NULL) ^ (uintptr_t)mat_c ^
+                   (__atomic_add_fetch(&seed_counter, 1, __ATOMIC_RELAXED) *
+                    0x9E3779B97F4A7C15ULL);
+  if (state == 0)
+    state = 1;
+
+  ret = 0;
+  for (unsigned round = 0; round < rounds; round++) {
+    // random vector r with entries in {0, 1}
+    for (size_t k = 0; k < n; k += 64) {
+      uint64_t bits = imatrix_random_next(&state);
+      for (size_t b = 0; b < 64 && k + b < n; b++)
+        r[k + b] = (bits >> b) & 1;
+    }
+
+    // A * (B * r) and C * r, both O(n^2)
+    imatrix_matvec(mat_b->data, n, n, r, br);
+    imatrix_matvec(mat_a->data, n, n, br, abr);
+    imatrix_matvec(mat_c->data, n, n, r, cr);
+
+    for (size_t i = 0; i < n; i++) {
+      if (abr[i] != cr[i] && !mismatch[i]) {
+        mismatch[i] = 1;
+        ret = 1;
+      }
+    }
+  }
+
+  if (ret == 1) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (!mismatch[i])
+        continue;
+      if (bad_rows)
+        bad_rows[count] = i;
+      count++;
+    }
+    if (bad_count)
+      *bad_count = count;
+  }
+
+cleanup:
+  free(r);
+  free(br);
+  free(abr);
+  free(cr);
+  free(mismatch);
+  return ret;
+}
+
+imatrix_t *imatrix_multiply_verified(imatrix_t *mat_a, imatrix_t *mat_b,
+                                     imatrix_algorithm_t algorithm,
+                                     unsigned rounds, size_t *bad_rows,
+                                     size_t *bad_count) {
+  if (bad_count)
+    *bad_count = 0;
+  // reject what the verification would reject before paying for the product
+  if (!mat_a || !mat_b || rounds == 0)
+    return NULL;
+  size_t n = mat_a->rows;
+  if (mat_a->cols != n || mat_b->rows != n || mat_b->cols != n)
+    return NULL;
+
+  imatrix_t *mat_c = imatrix_multiply(mat_a, mat_b, algorithm);
+  if (mat_c == NULL)
+    return NULL;
+  if (imatrix_verify_freivalds(mat_a, mat_b, mat_c, rounds, bad_rows,
+                               bad_count) != 0) {
+    imatrix_free(mat_c);
+    return NULL;
+  }
+  return mat_c;
+}
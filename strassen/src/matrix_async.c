@@ -0,0 +1,328 @@
+/**
+ * @file matrix_async.c
+ * @author Gonzalo G. Fernandez
+ * @brief Implementation of the asynchronous matrix multiplication queue.
+ */
+
+#include "matrix_async.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Submitted multiplication, shared by the caller handle and the queue.
+typedef struct imatrix_job_s {
+  imatrix_queue_t *queue; // referenced until the job is released
+  imatrix_t *matrix_a;
+  imatrix_t *matrix_b;
+  imatrix_algorithm_t algorithm;
+  imatrix_job_callback_t callback;
+  void *arg;
+
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+  imatrix_job_state_t state;
+  imatrix_t *result;
+  int refs; // caller handle + queue, protected by lock
+} imatrix_job_t;
+
+// Bounded ring buffer of pending jobs served by the workers.
+typedef struct imatrix_queue_s {
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  imatrix_job_t **jobs;
+  size_t capacity;
+  size_t head;  // next job to run
+  size_t count; // pending jobs
+  int stop;
+  int refs; // owner + jobs + submitters inside push, protected by lock
+
+  pthread_t *workers;
+  size_t nworkers;
+  int team_size; // OpenMP threads each worker may use for one job
+} imatrix_queue_t;
+
+// Drop one reference, the last one releases the queue memory
+static void imatrix_queue_release(imatrix_queue_t *queue) {
+  pthread_mutex_lock(&queue->lock);
+  int refs = --queue->refs;
+  pthread_mutex_unlock(&queue->lock);
+  if (refs > 0)
+    return;
+  pthread_mutex_destroy(&queue->lock);
+  pthread_cond_destroy(&queue->not_empty);
+  pthread_cond_destroy(&queue->not_full);
+  free(queue->jobs);
+  free(queue);
+}
+
+// Drop one reference, the last one releases the job
+static void imatrix_job_release(imatrix_job_t *job) {
+  pthread_mutex_lock(&job->lock);
+  int refs = --job->refs;
+  pthread_mutex_unlock(&job->lock);
+  if (refs > 0)
+    return;
+  imatrix_queue_t *queue = job->queue;
+  imatrix_free(job->result);
+  pthread_mutex_destroy(&job->lock);
+  pthread_cond_destroy(&job->finished);
+  free(job);
+  imatrix_queue_release(queue);
+}
+
+// Set the final state of a job, run its callback if asked and wake up
+// waiters
+static void imatrix_job_finish(imatrix_job_t *job, imatrix_job_state_t state,
+                               imatrix_t *result, int notify) {
+  pthread_mutex_lock(&job->lock);
+  job->result = result;
+  pthread_mutex_unlock(&job->lock);
+
+  // the callback runs before waiters are released so they see its effects,
+  // which is also why it must not wait on its own job
+  if (notify && job->callback)
+    job->callback(job, result, job->arg);
+
+  pthread_mutex_lock(&job->lock);
+  job->state = state;
+  pthread_cond_broadcast(&job->finished);
+  pthread_mutex_unlock(&job->lock);
+}
+
+// Take a pending job out of the ring, the queue lock must be held.
+// Returns 0 if removed, -1 if a worker already took it.
+static int imatrix_queue_remove(imatrix_queue_t *queue, imatrix_job_t *job) {
+  size_t k = 0;
+  while (k < queue->count &&
+         queue->jobs[(queue->head + k) % queue->capacity] != job)
+    k++;
+  if (k == queue->count)
+    return -1;
+  // close the gap, jobs behind keep their order
+  for (; k + 1 < queue->count; k++) {
+    queue->jobs[(queue->head + k) % queue->capacity] =
+        queue->jobs[(queue->head + k + 1) % queue->capacity];
+  }
+  queue->count--;
+  pthread_cond_signal(&queue->not_full);
+  return 0;
+}
+
+static void *imatrix_queue_worker(void *arg) {
+  imatrix_queue_t *queue = arg;
+
+#ifdef _OPENMP
+  // parallel engines of concurrent jobs share the cores instead of each
+  // starting a full team
+  omp_set_num_threads(queue->team_size);
+#endif
+
+  for (;;) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->stop)
+      pthread_cond_wait(&queue->not_empty, &queue->lock);
+    if (queue->count == 0) {
+      pthread_mutex_unlock(&queue->lock);
+      return NULL; // stopped and drained
+    }
+    imatrix_job_t *job = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    int stopping = queue->stop;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+
+    if (stopping) {
+      // the queue is being deleted, jobs left behind are not run
+      imatrix_job_finish(job, IMATRIX_JOB_CANCELLED, NULL, 1);
+      imatrix_job_release(job);
+      continue;
+    }
+
+    // out of the ring, so cancel can no longer take it
+    pthread_mutex_lock(&job->lock);
+    job->state = IMATRIX_JOB_RUNNING;
+    pthread_mutex_unlock(&job->lock);
+
+    imatrix_t *result =
+        imatrix_multiply(job->matrix_a, job->matrix_b, job->algorithm);
+    imatrix_job_finish(job, result ? IMATRIX_JOB_DONE : IMATRIX_JOB_FAILED,
+                       result, 1);
+    imatrix_job_release(job);
+  }
+}
+
+imatrix_queue_t *imatrix_queue_new(size_t workers, size_t capacity) {
+  if (workers == 0 || capacity == 0) {
+    return NULL;
+  }
+  imatrix_queue_t *queue = calloc(1, sizeof(imatrix_queue_t));
+  if (queue == NULL) {
+    return NULL;
+  }
+  queue->jobs = calloc(capacity, sizeof(imatrix_job_t *));
+  queue->workers = calloc(workers, sizeof(pthread_t));
+  if (queue->jobs == NULL || queue->workers == NULL) {
+    free(queue->jobs);
+    free(queue->workers);
+    free(queue);
+    return NULL;
+  }
+  queue->capacity = capacity;
+  queue->refs = 1;
+  queue->team_size = 1;
+#ifdef _OPENMP
+  if ((size_t)omp_get_num_procs() > workers)
+    queue->team_size = omp_get_num_procs() / (int)workers;
+#endif
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+  pthread_cond_init(&queue->not_full, NULL);
+
+  for (size_t w = 0; w < workers; w++) {
+    if (pthread_create(&queue->workers[w], NULL, imatrix_queue_worker,
+                       queue) != 0) {
+      break;
+    }
+    queue->nworkers++;
+  }
+  if (queue->nworkers == 0) {
+    imatrix_queue_free(queue);
+    return NULL;
+  }
+  return queue;
+}
+
+void imatrix_queue_free(imatrix_queue_t *queue) {
+  if (!queue)
+    return;
+
+  // workers cancel the pending jobs they pop from now on
+  pthread_mutex_lock(&queue->lock);
+  queue->stop = 1;
+  pthread_cond_broadcast(&queue->not_empty);
+  pthread_cond_broadcast(&queue->not_full);
+  pthread_mutex_unlock(&queue->lock);
+
+  for (size_t w = 0; w < queue->nworkers; w++) {
+    pthread_join(queue->workers[w], NULL);
+  }
+  free(queue->workers);
+
+  // woken submitters and live job handles still use the lock, the last of
+  // them releases the memory
+  imatrix_queue_release(queue);
+}
+
+static imatrix_job_t *imatrix_queue_push(imatrix_queue_t *queue,
+                                         imatrix_t *matrix_a,
+                                         imatrix_t *matrix_b,
+                                         imatrix_algorithm_t algorithm,
+                                         imatrix_job_callback_t callback,
+                                         void *arg, int block) {
+  if (queue == NULL || matrix_a == NULL || matrix_b == NULL) {
+    return NULL;
+  }
+  imatrix_job_t *job = calloc(1, sizeof(imatrix_job_t));
+  if (job == NULL) {
+    return NULL;
+  }
+  job->queue = queue;
+  job->matrix_a = matrix_a;
+  job->matrix_b = matrix_b;
+  job->algorithm = algorithm;
+  job->callback = callback;
+  job->arg = arg;
+  job->state = IMATRIX_JOB_PENDING;
+  job->refs = 2;
+  pthread_mutex_init(&job->lock, NULL);
+  pthread_cond_init(&job->finished, NULL);
+
+  pthread_mutex_lock(&queue->lock);
+  queue->refs++; // kept by the job if it is queued
+  while (block && queue->count == queue->capacity && !queue->stop)
+    pthread_cond_wait(&queue->not_full, &queue->lock);
+  if (queue->count == queue->capacity || queue->stop) {
+    pthread_mutex_unlock(&queue->lock);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->finished);
+    free(job);
+    imatrix_queue_release(queue);
+    return NULL;
+  }
+  queue->jobs[(queue->head + queue->count) % queue->capacity] = job;
+  queue->count++;
+  pthread_cond_signal(&queue->not_empty);
+  pthread_mutex_unlock(&queue->lock);
+  return job;
+}
+
+imatrix_job_t *imatrix_queue_submit(imatrix_queue_t *queue,
+                                    imatrix_t *matrix_a, imatrix_t *matrix_b,
+                                    imatrix_algorithm_t algorithm,
+                                    imatrix_job_callback_t callback,
+                                    void *arg) {
+  return imatrix_queue_push(queue, matrix_a, matrix_b, algorithm, callback,
+                            arg, 1);
+}
+
+imatrix_job_t *imatrix_queue_try_submit(imatrix_queue_t *queue,
+                                        imatrix_t *matrix_a,
+                                        imatrix_t *matrix_b,
+                                        imatrix_algorithm_t algorithm,
+                                        imatrix_job_callback_t callback,
+                                        void *arg) {
+  return imatrix_queue_push(queue, matrix_a, matrix_b, algorithm, callback,
+                            arg, 0);
+}
+
+imatrix_job_state_t imatrix_job_poll(imatrix_job_t *job) {
+  if (job == NULL) {
+    return IMATRIX_JOB_FAILED;
+  }
+  pthread_mutex_lock(&job->lock);
+  imatrix_job_state_t state = job->state;
+  pthread_mutex_unlock(&job->lock);
+  return state;
+}
+
+imatrix_t *imatrix_job_wait(imatrix_job_t *job) {
+  if (job == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&job->lock);
+  while (job->state == IMATRIX_JOB_PENDING ||
+         job->state == IMATRIX_JOB_RUNNING)
+    pthread_cond_wait(&job->finished, &job->lock);
+  imatrix_t *result = job->result;
+  job->result = NULL; // ownership goes to the caller
+  pthread_mutex_unlock(&job->lock);
+  return result;
+}
+
+int imatrix_job_cancel(imatrix_job_t *job) {
+  if (job == NULL) {
+    return -1;
+  }
+  imatrix_queue_t *queue = job->queue;
+  pthread_mutex_lock(&queue->lock);
+  int ret = imatrix_queue_remove(queue, job);
+  pthread_mutex_unlock(&queue->lock);
+  if (ret < 0)
+    return -1;
+
+  // no callback: it would run on the caller thread, maybe under its locks
+  imatrix_job_finish(job, IMATRIX_JOB_CANCELLED, NULL, 0);
+  imatrix_job_release(job); // reference held by the ring
+  return 0;
+}
+
+void imatrix_job_free(imatrix_job_t *job) {
+  if (!job)
+    return;
+  imatrix_job_release(job);
+}
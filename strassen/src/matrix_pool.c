@@ -0,0 +1,188 @@
+/**
+ * @file matrix_pool.c
+ * @author Gonzalo G. Fernandez
+ * @brief Implementation of the matrix memory pool.
+ */
+
+#include "matrix_pool.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#define POOL_MIN_SHIFT 6   // smallest class is 64 bytes, room for the link
+#define POOL_NCLASSES 64   // one class per power of 2 up to 2^63
+#define POOL_THREAD_MAX 4  // buffers per class kept by each thread
+
+// Free buffers are chained through their first bytes.
+typedef struct pool_node_s {
+  struct pool_node_s *next;
+} pool_node_t;
+
+// Free lists of one thread.
+typedef struct {
+  pool_node_t *head[POOL_NCLASSES];
+  unsigned count[POOL_NCLASSES];
+} pool_cache_t;
+
+static int pool_enabled;
+
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static pool_cache_t shared; // count is not bounded here
+
+static size_t bytes_in_use;
+static size_t bytes_cached;
+static size_t bytes_total; // in use + cached, only moves on miss and trim
+static size_t high_water;
+static size_t hits;
+static size_t misses;
+
+static _Thread_local pool_cache_t local;
+static _Thread_local int local_registered;
+static pthread_key_t local_key;
+static pthread_once_t local_key_once = PTHREAD_ONCE_INIT;
+
+// Smallest class whose capacity holds the given bytes, -1 if none does
+static int pool_class(size_t bytes) {
+  unsigned shift = POOL_MIN_SHIFT;
+  while (shift < POOL_NCLASSES - 1 && ((size_t)1 << shift) < bytes)
+    shift++;
+  if (((size_t)1 << shift) < bytes)
+    return -1;
+  return (int)shift;
+}
+
+static void pool_update_high_water(size_t total) {
+  size_t cur = __atomic_load_n(&high_water, __ATOMIC_RELAXED);
+  while (cur < total &&
+         !__atomic_compare_exchange_n(&high_water, &cur, total, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+// Move every buffer of a thread cache to the shared cache
+static void pool_flush(pool_cache_t *cache) {
+  pthread_mutex_lock(&shared_lock);
+  for (unsigned c = 0; c < POOL_NCLASSES; c++) {
+    while (cache->head[c]) {
+      pool_node_t *node = cache->head[c];
+      cache->head[c] = node->next;
+      node->next = shared.head[c];
+      shared.head[c] = node;
+    }
+    cache->count[c] = 0;
+  }
+  pthread_mutex_unlock(&shared_lock);
+}
+
+static void pool_thread_exit(void *cache) { pool_flush(cache); }
+
+static void pool_make_key(void) {
+  pthread_key_create(&local_key, pool_thread_exit);
+}
+
+// Make sure the thread cache is flushed when the thread exits
+static void pool_register_thread(void) {
+  if (local_registered)
+    return;
+  pthread_once(&local_key_once, pool_make_key);
+  pthread_setspecific(local_key, &local);
+  local_registered = 1;
+}
+
+void imatrix_pool_enable(int enable) {
+  __atomic_store_n(&pool_enabled, enable != 0, __ATOMIC_RELAXED);
+}
+
+int imatrix_pool_enabled(void) {
+  return __atomic_load_n(&pool_enabled, __ATOMIC_RELAXED);
+}
+
+void *imatrix_pool_alloc(size_t bytes, int zeroed) {
+  int c = pool_class(bytes);
+  if (c < 0)
+    return NULL; // larger than the largest size class
+  size_t capacity = (size_t)1 << c;
+  pool_node_t *node = local.head[c];
+
+  if (node) {
+    local.head[c] = node->next;
+    local.count[c]--;
+  } else {
+    pthread_mutex_lock(&shared_lock);
+    node = shared.head[c];
+    if (node)
+      shared.head[c] = node->next;
+    pthread_mutex_unlock(&shared_lock);
+  }
+
+  if (node) {
+    __atomic_fetch_add(&hits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&bytes_cached, capacity, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&bytes_in_use, capacity, __ATOMIC_RELAXED);
+    // recycled buffers are dirty, zero only what the caller will see
+    if (zeroed)
+      memset(node, 0, bytes);
+    return node;
+  }
+
+  // fresh memory from calloc is already zero, no need to touch it
+  void *ptr = zeroed ? calloc(1, capacity) : malloc(capacity);
+  if (ptr == NULL)
+    return NULL;
+  __atomic_fetch_add(&misses, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&bytes_in_use, capacity, __ATOMIC_RELAXED);
+  pool_update_high_water(
+      __atomic_add_fetch(&bytes_total, capacity, __ATOMIC_RELAXED));
+  return ptr;
+}
+
+void imatrix_pool_release(void *ptr, size_t bytes) {
+  int c = pool_class(bytes);
+  if (!ptr || c < 0)
+    return;
+  size_t capacity = (size_t)1 << c;
+  pool_node_t *node = ptr;
+
+  __atomic_fetch_sub(&bytes_in_use, capacity, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&bytes_cached, capacity, __ATOMIC_RELAXED);
+
+  if (local.count[c] < POOL_THREAD_MAX) {
+    pool_register_thread();
+    node->next = local.head[c];
+    local.head[c] = node;
+    local.count[c]++;
+    return;
+  }
+  pthread_mutex_lock(&shared_lock);
+  node->next = shared.head[c];
+  shared.head[c] = node;
+  pthread_mutex_unlock(&shared_lock);
+}
+
+void imatrix_pool_trim(void) {
+  pool_flush(&local);
+
+  pthread_mutex_lock(&shared_lock);
+  for (unsigned c = 0; c < POOL_NCLASSES; c++) {
+    while (shared.head[c]) {
+      pool_node_t *node = shared.head[c];
+      shared.head[c] = node->next;
+      free(node);
+      __atomic_fetch_sub(&bytes_cached, (size_t)1 << c, __ATOMIC_RELAXED);
+      __atomic_fetch_sub(&bytes_total, (size_t)1 << c, __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&shared_lock);
+}
+
+int imatrix_pool_get_stats(imatrix_pool_stats_t *stats) {
+  if (stats == NULL) {
+    return -1;
+  }
+  stats->bytes_in_use = __atomic_load_n(&bytes_in_use, __ATOMIC_RELAXED);
+  stats->bytes_cached = __atomic_load_n(&bytes_cached, __ATOMIC_RELAXED);
+  stats->high_water = __atomic_load_n(&high_water, __ATOMIC_RELAXED);
+  stats->hits = __atomic_load_n(&hits, __ATOMIC_RELAXED);
+  stats->misses = __atomic_load_n(&misses, __ATOMIC_RELAXED);
+  return 0;
+}
@@ -0,0 +1,304 @@
+/**
+ * @file matrix_profile.c
+ * @author Gonzalo G. Fernandez
+ * @brief Implementation of the multiply engines instrumentation.
+ */
+
+#include "matrix_profile.h"
+
+#ifdef IMATRIX_PROFILE
+
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define PROF_STACK_SIZE 64
+
+// Hardware counters read as a single perf_event group.
+enum { HW_CYCLES = 0, HW_INSTRUCTIONS, HW_LLC_MISSES, HW_NCOUNTERS };
+
+// Statistics of one recursion level of one engine.
+typedef struct {
+  uint64_t calls;
+  uint64_t n;            // largest block size seen at this level
+  uint64_t inclusive_ns; // time of the whole call, children included
+  uint64_t phase_ns[IMATRIX_PROF_NPHASES];
+  uint64_t bytes;
+  uint64_t ops;
+  uint64_t hw[HW_NCOUNTERS]; // inclusive, like inclusive_ns
+} prof_level_t;
+
+// Snapshot taken when a recursion call starts.
+typedef struct {
+  imatrix_prof_engine_t engine;
+  int level;
+  uint64_t start_ns;
+  uint64_t hw[HW_NCOUNTERS];
+  int hw_valid;
+  int leaf; // root of a folded leaf subtree
+} prof_frame_t;
+
+static prof_level_t levels[IMATRIX_PROF_NENGINES][IMATRIX_PROF_MAX_LEVELS];
+static int hw_available; // set once any thread managed to open its counters
+
+// Every thread keeps its own call stack and counter group.
+static _Thread_local prof_frame_t stack[PROF_STACK_SIZE];
+static _Thread_local int depth;
+static _Thread_local int hw_fd = -2; // -2 not opened yet, -1 unavailable
+static _Thread_local int hw_fds[HW_NCOUNTERS]; // leader first, then members
+
+// Inside a folded leaf subtree the hooks only count nesting and gather the
+// ops and bytes, which are flushed once when the subtree root leaves.
+static _Thread_local int leaf_depth;
+static _Thread_local uint64_t leaf_ops;
+static _Thread_local uint64_t leaf_bytes;
+
+static const char *engine_names[IMATRIX_PROF_NENGINES] = {
+    "recursive", "recursive_parallel", "strassen"};
+static const char *phase_names[IMATRIX_PROF_NPHASES] = {"alloc", "addsub",
+                                                        "leaf"};
+static const char *hw_names[HW_NCOUNTERS] = {"cycles", "instructions",
+                                             "llc_misses"};
+
+static void add_u64(uint64_t *dst, uint64_t value) {
+  __atomic_fetch_add(dst, value, __ATOMIC_RELAXED);
+}
+
+static void max_u64(uint64_t *dst, uint64_t value) {
+  uint64_t cur = __atomic_load_n(dst, __ATOMIC_RELAXED);
+  while (cur < value && !__atomic_compare_exchange_n(dst, &cur, value, 1,
+                                                     __ATOMIC_RELAXED,
+                                                     __ATOMIC_RELAXED))
+    ;
+}
+
+#ifdef __linux__
+static int perf_open(uint64_t config, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = group_fd == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+// Close every descriptor of a counter group
+static void hw_close(int *fds) {
+  for (int c = 0; c < HW_NCOUNTERS; c++) {
+    if (fds[c] >= 0)
+      close(fds[c]);
+    fds[c] = -1;
+  }
+}
+
+static pthread_key_t hw_key;
+static pthread_once_t hw_key_once = PTHREAD_ONCE_INIT;
+
+static void hw_thread_exit(void *fds) { hw_close(fds); }
+
+static void hw_make_key(void) { pthread_key_create(&hw_key, hw_thread_exit); }
+
+static void hw_open(void) {
+  static const uint64_t configs[HW_NCOUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES};
+
+  hw_fd = -1;
+  for (int c = 0; c < HW_NCOUNTERS; c++)
+    hw_fds[c] = -1;
+  for (int c = 0; c < HW_NCOUNTERS; c++) {
+    hw_fds[c] = perf_open(configs[c], c == 0 ? -1 : hw_fds[0]);
+    if (hw_fds[c] < 0) {
+      hw_close(hw_fds);
+      return;
+    }
+  }
+  hw_fd = hw_fds[0];
+
+  // worker threads come and go, their groups are closed when they exit
+  pthread_once(&hw_key_once, hw_make_key);
+  pthread_setspecific(hw_key, hw_fds);
+
+  ioctl(hw_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(hw_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  __atomic_store_n(&hw_available, 1, __ATOMIC_RELAXED);
+}
+
+static int hw_read(uint64_t *values) {
+  if (hw_fd == -2)
+    hw_open();
+  if (hw_fd < 0)
+    return -1;
+
+  uint64_t buf[1 + HW_NCOUNTERS]; // nr followed by the values
+  if (read(hw_fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf))
+    return -1;
+  memcpy(values, &buf[1], sizeof(uint64_t) * HW_NCOUNTERS);
+  return 0;
+}
+#else
+static int hw_read(uint64_t *values) {
+  (void)values;
+  return -1;
+}
+#endif // __linux__
+
+static prof_level_t *current_level(void) {
+  if (depth == 0)
+    return NULL; // hook called outside of any recursion
+  const prof_frame_t *frame = &stack[depth - 1];
+  int level = frame->level;
+  if (level >= IMATRIX_PROF_MAX_LEVELS)
+    level = IMATRIX_PROF_MAX_LEVELS - 1;
+  return &levels[frame->engine][level];
+}
+
+uint64_t imatrix_prof_now(void) {
+  if (leaf_depth)
+    return 0; // phases are not timed inside a leaf subtree
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void imatrix_profile_reset(void) { memset(levels, 0, sizeof(levels)); }
+
+void imatrix_prof_enter(imatrix_prof_engine_t engine, size_t n, int level) {
+  if (leaf_depth) {
+    leaf_depth++;
+    return;
+  }
+  if (depth >= PROF_STACK_SIZE) {
+    depth++; // keep enter/leave balanced, stats are lost for this call
+    return;
+  }
+  prof_frame_t *frame = &stack[depth];
+  frame->engine = engine;
+  frame->level = level < 0 ? depth : level;
+  frame->leaf = n <= IMATRIX_PROF_LEAF_SIZE;
+  depth++;
+
+  prof_level_t *stats = current_level();
+  add_u64(&stats->calls, 1);
+  max_u64(&stats->n, n);
+
+  frame->hw_valid = hw_read(frame->hw) == 0;
+  frame->start_ns = imatrix_prof_now(); // last, so the hooks are not timed
+  if (frame->leaf) {
+    leaf_depth = 1;
+    leaf_ops = 0;
+    leaf_bytes = 0;
+  }
+}
+
+void imatrix_prof_leave(void) {
+  if (leaf_depth > 1) {
+    leaf_depth--;
+    return;
+  }
+  leaf_depth = 0;
+  if (depth > PROF_STACK_SIZE) {
+    depth--;
+    return;
+  }
+  uint64_t end_ns = imatrix_prof_now();
+  prof_level_t *level = current_level();
+  prof_frame_t *frame = &stack[depth - 1];
+
+  add_u64(&level->inclusive_ns, end_ns - frame->start_ns);
+  if (frame->leaf) {
+    add_u64(&level->phase_ns[IMATRIX_PROF_LEAF], end_ns - frame->start_ns);
+    add_u64(&level->ops, leaf_ops);
+    add_u64(&level->bytes, leaf_bytes);
+  }
+
+  uint64_t hw[HW_NCOUNTERS];
+  if (frame->hw_valid && hw_read(hw) == 0) {
+    for (int c = 0; c < HW_NCOUNTERS; c++)
+      add_u64(&level->hw[c], hw[c] - frame->hw[c]);
+  }
+  depth--;
+}
+
+void imatrix_prof_add_time(imatrix_prof_phase_t phase, uint64_t ns) {
+  if (leaf_depth)
+    return; // the leaf subtree is timed as a whole
+  prof_level_t *level = current_level();
+  if (level)
+    add_u64(&level->phase_ns[phase], ns);
+}
+
+void imatrix_prof_add_bytes(size_t bytes) {
+  if (leaf_depth) {
+    leaf_bytes += bytes;
+    return;
+  }
+  prof_level_t *level = current_level();
+  if (level)
+    add_u64(&level->bytes, bytes);
+}
+
+void imatrix_prof_add_ops(size_t ops) {
+  if (leaf_depth) {
+    leaf_ops += ops;
+    return;
+  }
+  prof_level_t *level = current_level();
+  if (level)
+    add_u64(&level->ops, ops);
+}
+
+int imatrix_profile_report(FILE *out) {
+  if (out == NULL)
+    return -1;
+
+  int hw = __atomic_load_n(&hw_available, __ATOMIC_RELAXED);
+
+  fprintf(out, "{\n  \"hw_counters\": %s,\n  \"engines\": {",
+          hw ? "true" : "false");
+  for (int e = 0; e < IMATRIX_PROF_NENGINES; e++) {
+    fprintf(out, "%s\n    \"%s\": [", e ? "," : "", engine_names[e]);
+    int first = 1;
+    for (int l = 0; l < IMATRIX_PROF_MAX_LEVELS; l++) {
+      const prof_level_t *s = &levels[e][l];
+      if (s->calls == 0)
+        continue;
+      fprintf(out,
+              "%s\n      {\"level\": %d, \"n\": %llu, \"calls\": %llu, "
+              "\"time_ns\": %llu",
+              first ? "" : ",", l, (unsigned long long)s->n,
+              (unsigned long long)s->calls,
+              (unsigned long long)s->inclusive_ns);
+      for (int p = 0; p < IMATRIX_PROF_NPHASES; p++)
+        fprintf(out, ", \"%s_ns\": %llu", phase_names[p],
+                (unsigned long long)s->phase_ns[p]);
+      fprintf(out, ", \"bytes_allocated\": %llu, \"element_ops\": %llu",
+              (unsigned long long)s->bytes, (unsigned long long)s->ops);
+      for (int c = 0; c < HW_NCOUNTERS; c++) {
+        if (hw)
+          fprintf(out, ", \"%s\": %llu", hw_names[c],
+                  (unsigned long long)s->hw[c]);
+        else
+          fprintf(out, ", \"%s\": null", hw_names[c]);
+      }
+      fprintf(out, "}");
+      first = 0;
+    }
+    fprintf(out, "%s]", first ? "" : "\n    ");
+  }
+  fprintf(out, "\n  }\n}\n");
+  return ferror(out) ? -1 : 0;
+}
+
+#endif // IMATRIX_PROFILE